@@ -9,9 +9,12 @@ cpp_common_test_test:
 cpp_common_test_full_test:
 	${MAKE} -C ${CPP_COMMON_TEST_DIR} full_test
 
+cpp_common_test_benchmark:
+	${MAKE} -C ${CPP_COMMON_TEST_DIR} benchmark
+
 cpp_common_test_clean:
 	${MAKE} -C ${CPP_COMMON_TEST_DIR} clean
 
 cpp_common_test_distclean: cpp_common_test_clean
 
-.PHONY: cpp_common_test cpp_common_test_test cpp_common_test_clean cpp_common_test_distclean
+.PHONY: cpp_common_test cpp_common_test_test cpp_common_test_benchmark cpp_common_test_clean cpp_common_test_distclean
@@ -571,6 +571,58 @@ TEST_F(BaseResolverTest, SRVRecordResolutionManyTargets)
   EXPECT_THAT(resolve, MatchesRegex("3.0.0.[0-9]{2}:3868;transport=SCTP"));
 }
 
+// Test that SRV resolution shares load between equally weighted targets at the
+// same priority.
+TEST_F(BaseResolverTest, SRVResolutionSpreadsLoadWithinPriority)
+{
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::srv("_diameter._sctp.cpp-common-test.cw-ngv.com", 3600, 0, 10, 3868, "cpp-common-test-1.cw-ngv.com"));
+  records.push_back(ResolverUtils::srv("_diameter._sctp.cpp-common-test.cw-ngv.com", 3600, 0, 10, 3868, "cpp-common-test-2.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_diameter._sctp.cpp-common-test.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(ResolverUtils::a("cpp-common-test-1.cw-ngv.com", 3600, "3.0.0.1"));
+  _dnsresolver.add_to_cache("cpp-common-test-1.cw-ngv.com", ns_t_a, records);
+  records.push_back(ResolverUtils::a("cpp-common-test-2.cw-ngv.com", 3600, "3.0.0.2"));
+  _dnsresolver.add_to_cache("cpp-common-test-2.cw-ngv.com", ns_t_a, records);
+
+  std::map<std::string, int> counts;
+
+  for (int ii = 0; ii < 1000; ++ii)
+  {
+    counts[first_result_from_srv("_diameter._sctp.cpp-common-test.cw-ngv.com")]++;
+  }
+
+  // Each target should get roughly half of the traffic.
+  EXPECT_GT(counts["3.0.0.1:3868;transport=SCTP"], 350);
+  EXPECT_GT(counts["3.0.0.2:3868;transport=SCTP"], 350);
+}
+
+// Test that SRV resolution favours targets with higher weights at the same
+// priority, without starving the lower weighted ones.
+TEST_F(BaseResolverTest, SRVResolutionRespectsWeights)
+{
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::srv("_diameter._sctp.cpp-common-test.cw-ngv.com", 3600, 0, 90, 3868, "cpp-common-test-1.cw-ngv.com"));
+  records.push_back(ResolverUtils::srv("_diameter._sctp.cpp-common-test.cw-ngv.com", 3600, 0, 10, 3868, "cpp-common-test-2.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_diameter._sctp.cpp-common-test.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(ResolverUtils::a("cpp-common-test-1.cw-ngv.com", 3600, "3.0.0.1"));
+  _dnsresolver.add_to_cache("cpp-common-test-1.cw-ngv.com", ns_t_a, records);
+  records.push_back(ResolverUtils::a("cpp-common-test-2.cw-ngv.com", 3600, "3.0.0.2"));
+  _dnsresolver.add_to_cache("cpp-common-test-2.cw-ngv.com", ns_t_a, records);
+
+  std::map<std::string, int> counts;
+
+  for (int ii = 0; ii < 1000; ++ii)
+  {
+    counts[first_result_from_srv("_diameter._sctp.cpp-common-test.cw-ngv.com")]++;
+  }
+
+  // The heavier target should get about 90% of the traffic.
+  EXPECT_GT(counts["3.0.0.1:3868;transport=SCTP"], 800);
+  EXPECT_GT(counts["3.0.0.2:3868;transport=SCTP"], 20);
+}
+
 // Test that a failed SRV lookup returns empty.
 TEST_F(BaseResolverTest, SRVRecordFailedResolution)
 {
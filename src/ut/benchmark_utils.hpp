@@ -0,0 +1,244 @@
+/**
+ * @file benchmark_utils.hpp Helpers for benchmarks built into the UT binary.
+ *
+ * Copyright (C) Metaswitch Networks 2019
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef BENCHMARK_UTILS_H__
+#define BENCHMARK_UTILS_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+/// Benchmarks are built into the UT binary, in fixtures whose names end in
+/// "Benchmark". test_main.cpp leaves them out of the run unless BENCHMARK_SCALE
+/// is set, so they don't slow down (or fail under valgrind in) make test and
+/// make full_test. To run them, use
+///
+///   make benchmark
+///
+/// which runs only the benchmarks with BENCHMARK_SCALE defaulting to 100.
+/// BENCHMARK_SCALE multiplies the work each benchmark does.
+///
+/// Benchmarks must not run with time under the control of the test interposer.
+namespace BenchmarkUtils
+{
+
+/// Returns the multiplier to apply to the amount of work each benchmark does.
+inline int scale()
+{
+  int scale = 1;
+  char* scale_str = getenv("BENCHMARK_SCALE");
+
+  if (scale_str != NULL)
+  {
+    scale = std::max(atoi(scale_str), 1);
+  }
+
+  return scale;
+}
+
+/// Returns the current monotonic time in nanoseconds.
+inline uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/// Collects per-operation latency samples and reports throughput and latency
+/// percentiles.
+class LatencyStats
+{
+public:
+  void add(uint64_t latency_ns)
+  {
+    _samples.push_back(latency_ns);
+  }
+
+  void merge(const LatencyStats& other)
+  {
+    _samples.insert(_samples.end(), other._samples.begin(), other._samples.end());
+  }
+
+  size_t count() const
+  {
+    return _samples.size();
+  }
+
+  /// Returns the latency (in nanoseconds) below which the given percentage of
+  /// the samples fall.
+  uint64_t percentile(double pct)
+  {
+    if (_samples.empty())
+    {
+      return 0;
+    }
+
+    std::sort(_samples.begin(), _samples.end());
+    size_t index = (size_t)((pct / 100.0) * (_samples.size() - 1));
+    return _samples[index];
+  }
+
+  /// Writes a single line summarising the benchmark to stdout.
+  ///
+  /// @param name       - Name of the benchmark.
+  /// @param elapsed_ns - Wall clock time taken to run all of the operations.
+  void report(const std::string& name, uint64_t elapsed_ns)
+  {
+    double elapsed_s = (double)elapsed_ns / 1000000000.0;
+    double ops_per_s = (elapsed_s > 0) ? (count() / elapsed_s) : 0;
+
+    std::cout << "[ BENCHMARK] " << name << ": "
+              << count() << " ops in "
+              << std::fixed << std::setprecision(1) << (elapsed_s * 1000) << "ms ("
+              << std::setprecision(0) << ops_per_s << " ops/s), latency us"
+              << std::setprecision(2)
+              << " p50=" << percentile(50) / 1000.0
+              << " p90=" << percentile(90) / 1000.0
+              << " p99=" << percentile(99) / 1000.0
+              << " p99.9=" << percentile(99.9) / 1000.0
+              << std::endl;
+  }
+
+private:
+  std::vector<uint64_t> _samples;
+};
+
+/// Runs an operation on a number of threads at once, timing each invocation.
+///
+/// @param num_threads    - The number of threads to run the operation on.
+/// @param ops_per_thread - How many times each thread runs the operation.
+/// @param op             - The operation. Called with the index of the thread
+///                         and the index of the operation on that thread.
+/// @param elapsed_ns     - (out) Wall clock time taken for all threads to
+///                         complete.
+/// @return the latency of every operation.
+inline LatencyStats run_concurrently(int num_threads,
+                                     int ops_per_thread,
+                                     std::function<void(int, int)> op,
+                                     uint64_t& elapsed_ns)
+{
+  std::vector<LatencyStats> thread_stats(num_threads);
+  std::vector<std::thread> threads;
+  std::atomic_bool go(false);
+
+  for (int ii = 0; ii < num_threads; ++ii)
+  {
+    threads.push_back(std::thread([ii, ops_per_thread, &op, &go, &thread_stats] () {
+      // Spin until all threads have been created so that they start together.
+      while (!go.load())
+      {
+        std::this_thread::yield();
+      }
+
+      for (int jj = 0; jj < ops_per_thread; ++jj)
+      {
+        uint64_t start_ns = now_ns();
+        op(ii, jj);
+        thread_stats[ii].add(now_ns() - start_ns);
+      }
+    }));
+  }
+
+  uint64_t start_ns = now_ns();
+  go.store(true);
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  elapsed_ns = now_ns() - start_ns;
+
+  LatencyStats stats;
+  for (LatencyStats& ts : thread_stats)
+  {
+    stats.merge(ts);
+  }
+
+  return stats;
+}
+
+/// Runs an operation a number of times on the calling thread, timing each
+/// invocation.
+///
+/// @param num_ops    - How many times to run the operation.
+/// @param op         - The operation. Called with the index of the operation.
+/// @param elapsed_ns - (out) Wall clock time taken for all of the operations.
+/// @return the latency of every operation.
+inline LatencyStats run_sequentially(int num_ops,
+                                     std::function<void(int)> op,
+                                     uint64_t& elapsed_ns)
+{
+  LatencyStats stats;
+  uint64_t start_ns = now_ns();
+
+  for (int ii = 0; ii < num_ops; ++ii)
+  {
+    uint64_t op_start_ns = now_ns();
+    op(ii);
+    stats.add(now_ns() - op_start_ns);
+  }
+
+  elapsed_ns = now_ns() - start_ns;
+  return stats;
+}
+
+/// Runs an operation concurrently at each of a list of thread counts, checks
+/// that every invocation succeeded, and reports the results for each thread
+/// count.
+///
+/// @param name           - Name of the benchmark.
+/// @param concurrencies  - The numbers of threads to run the operation on.
+/// @param ops_per_thread - How many times each thread runs the operation.
+/// @param op             - The operation, which returns false if it failed.
+///                         Called with the index of the thread and the index
+///                         of the operation on that thread.
+inline void run_at_concurrencies(const std::string& name,
+                                 std::initializer_list<int> concurrencies,
+                                 int ops_per_thread,
+                                 std::function<bool(int, int)> op)
+{
+  for (int num_threads : concurrencies)
+  {
+    std::atomic_int failures(0);
+    uint64_t elapsed_ns;
+
+    LatencyStats stats = run_concurrently(
+      num_threads,
+      ops_per_thread,
+      [&op, &failures] (int thread, int index) {
+        if (!op(thread, index))
+        {
+          failures++;
+        }
+      },
+      elapsed_ns);
+
+    EXPECT_EQ(0, failures.load()) << name << " with " << num_threads << " threads";
+    stats.report(name + " (" + std::to_string(num_threads) + " threads)", elapsed_ns);
+  }
+}
+
+}
+
+#endif
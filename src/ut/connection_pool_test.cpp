@@ -10,12 +10,20 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "test_interposer.hpp"
+#include "benchmark_utils.hpp"
 
 #include "testable_connection_pool.h"
 
+using ::testing::AnyNumber;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::_;
 
@@ -177,6 +185,35 @@ TEST_F(ConnectionPoolTest, RemoveIdleConnections)
   EXPECT_CALL(conn_pool, destroy_connection(ai_2, 3)).Times(1);
 }
 
+// Test that a connection's idle time is measured from when it was last
+// returned to the pool, so a connection that is in regular use is never
+// removed, however long ago it was created
+TEST_F(ConnectionPoolTest, IdleTimeRestartsOnReturn)
+{
+  EXPECT_CALL(conn_pool, create_connection(ai_1)).Times(1).WillOnce(Return(1));
+  EXPECT_CALL(conn_pool, create_connection(ai_2)).Times(1).WillOnce(Return(2));
+
+  // Create the connection, then use it again just before it would become idle,
+  // several times over
+  conn_pool.get_connection(ai_1);
+
+  for (int ii = 0; ii < 3; ++ii)
+  {
+    cwtest_advance_time_ms(1000 * TEST_MAX_IDLE_TIME_S - TEST_TIME_DELTA_MS);
+
+    // Retrieve and return a connection for a different AddrInfo to trigger
+    // the removal of any idle connections
+    conn_pool.get_connection(ai_2);
+
+    ConnectionHandle<int> conn_handle = conn_pool.get_connection(ai_1);
+    EXPECT_EQ(conn_handle.get_connection(), 1);
+  }
+
+  // Check that the connections are correctly destroyed
+  EXPECT_CALL(conn_pool, destroy_connection(ai_1, 1)).Times(1);
+  EXPECT_CALL(conn_pool, destroy_connection(ai_2, 2)).Times(1);
+}
+
 TEST_F(ConnectionPoolTest, MoveConnectionHandle)
 {
   EXPECT_CALL(conn_pool, create_connection(ai_1)).Times(2).WillOnce(Return(1)).WillOnce(Return(2));
@@ -253,3 +290,109 @@ TEST_F(ConnectionPoolTest, FreeOnError)
   EXPECT_CALL(conn_pool, destroy_connection(ai_1, 3)).Times(1);
   EXPECT_CALL(conn_pool, destroy_connection(ai_2, 11)).Times(1);
 }
+
+// Test that when many threads share the pool, a connection is never handed
+// out to more than one of them at once
+TEST_F(ConnectionPoolTest, ConcurrentConnectionsAreExclusive)
+{
+  std::atomic_int next_connection(1);
+  EXPECT_CALL(conn_pool, create_connection(_)).Times(AnyNumber())
+    .WillRepeatedly(Invoke([&next_connection] (AddrInfo target) {
+      return next_connection++;
+    }));
+  EXPECT_CALL(conn_pool, destroy_connection(_, _)).Times(AnyNumber());
+
+  std::mutex in_use_lock;
+  std::set<int> in_use;
+  std::atomic_int clashes(0);
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < 8; ++ii)
+  {
+    threads.push_back(std::thread([this, ii, &in_use_lock, &in_use, &clashes] () {
+      for (int jj = 0; jj < 1000; ++jj)
+      {
+        ConnectionHandle<int> conn_handle =
+          conn_pool.get_connection(((ii + jj) % 2 == 0) ? ai_1 : ai_2);
+        int connection = conn_handle.get_connection();
+
+        {
+          std::lock_guard<std::mutex> lock(in_use_lock);
+          if (!in_use.insert(connection).second)
+          {
+            clashes++;
+          }
+        }
+
+        std::this_thread::yield();
+
+        {
+          std::lock_guard<std::mutex> lock(in_use_lock);
+          in_use.erase(connection);
+        }
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, clashes.load());
+
+  // Connections are reused, so no more are created than there were threads
+  // wanting one at the same time, for each target
+  EXPECT_LE(next_connection.load() - 1, 16);
+}
+
+/// Fixture for ConnectionPool benchmarks. Connections are plain integers
+/// handed out by the TestableConnectionPool, so these measure the cost of
+/// the pool itself (including contention on its lock).
+class ConnectionPoolBenchmark : public ::testing::Test
+{
+public:
+  static const int NUM_TARGETS = 4;
+
+  ConnectionPoolBenchmark() :
+    conn_pool(60),
+    next_connection(1)
+  {
+    for (int ii = 0; ii < NUM_TARGETS; ++ii)
+    {
+      AddrInfo ai;
+      ai.address.af = AF_INET;
+      inet_pton(AF_INET, "0.0.0.0", &ai.address.addr.ipv4);
+      ai.port = ii + 1;
+      ai.transport = 0;
+      targets.push_back(ai);
+    }
+
+    EXPECT_CALL(conn_pool, create_connection(_)).Times(AnyNumber())
+      .WillRepeatedly(Invoke([this] (AddrInfo target) {
+        return next_connection++;
+      }));
+    EXPECT_CALL(conn_pool, destroy_connection(_, _)).Times(AnyNumber());
+  }
+
+  TestableConnectionPool conn_pool;
+  std::vector<AddrInfo> targets;
+  std::atomic_int next_connection;
+};
+
+// Measures the rate at which threads can get and return connections, with each
+// thread mostly talking to the same target.
+TEST_F(ConnectionPoolBenchmark, GetAndReturn)
+{
+  BenchmarkUtils::run_at_concurrencies(
+    "ConnectionPool get and return",
+    {1, 4, 16},
+    1000 * BenchmarkUtils::scale(),
+    [this] (int thread, int op) {
+      // One request in ten goes to a different target.
+      int target = (op % 10 == 0) ? (op / 10) : thread;
+      ConnectionHandle<int> conn_handle =
+        conn_pool.get_connection(targets[target % NUM_TARGETS]);
+      return (conn_handle.get_connection() != 0);
+    });
+}
@@ -17,6 +17,7 @@
 #include "dnscachedresolver.h"
 #include "diameterresolver.h"
 #include "test_utils.hpp"
+#include "benchmark_utils.hpp"
 #include "resolver_utils.h"
 #include "test_interposer.hpp"
 
@@ -141,6 +142,29 @@ TEST_F(DiameterResolverTest, NAPTRSRVResolutionWithRegex)
   RT(_diameterresolver, "sprout.cw-ngv.com").resolve("3.0.0.1:3868;transport=SCTP", 2400);
 }
 
+// Resolving through a NAPTR record with a regex repeatedly, so that the NAPTR
+// lookups after the first are served from the NAPTR cache, should give the
+// same result every time.
+TEST_F(DiameterResolverTest, NAPTRSRVResolutionWithRegexRepeated)
+{
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::naptr("sprout.cw-ngv.com", 3600, 0, 0, "", "AAA+D2S", "/(.*)/a$1/", ""));
+  _dnsresolver.add_to_cache("sprout.cw-ngv.com", ns_t_naptr, records);
+  records.push_back(ResolverUtils::naptr("asprout.cw-ngv.com", 3600, 0, 0, "s", "AAA+D2S", "", "_diameter._sctp.sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("asprout.cw-ngv.com", ns_t_naptr, records);
+
+  records.push_back(ResolverUtils::srv("_diameter._sctp.sprout-1.cw-ngv.com", 3600, 0, 0, 3868, "sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_diameter._sctp.sprout-1.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(ResolverUtils::a("sprout-1.cw-ngv.com", 3600, "3.0.0.1"));
+  _dnsresolver.add_to_cache("sprout-1.cw-ngv.com", ns_t_a, records);
+
+  for (int ii = 0; ii < 5; ++ii)
+  {
+    RT(_diameterresolver, "sprout.cw-ngv.com").resolve("3.0.0.1:3868;transport=SCTP", 3600);
+  }
+}
+
 TEST_F(DiameterResolverTest, SimpleNAPTRSRVSCTPResolution)
 {
   // Test selection of SCTP transport and port using NAPTR and SRV records (and lowercase S).
@@ -302,3 +326,55 @@ TEST_F(DiameterResolverTest, ZeroTTLReturned)
    RT(_diameterresolver, "sprout.cw-ngv.com").resolve("3.0.0.1:3868;transport=SCTP", 0);
 }
 
+
+/// Fixture for DiameterResolver benchmarks. As in the UTs, the records are
+/// added straight to the cache.
+class DiameterResolverBenchmark : public ::testing::Test
+{
+  DnsCachedResolver _dnsresolver;
+  DiameterResolver _diameterresolver;
+
+  DiameterResolverBenchmark() :
+    _dnsresolver("0.0.0.0"),
+    _diameterresolver(&_dnsresolver, AF_INET)
+  {
+  }
+};
+
+// Measures the rate of realm resolution through a NAPTR record whose regex
+// rewrites the realm, as used in Diameter realm routing.
+TEST_F(DiameterResolverBenchmark, NAPTRRegexResolution)
+{
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::naptr("sprout.cw-ngv.com", 3600, 0, 0, "", "AAA+D2S", "/(.*)/a$1/", ""));
+  _dnsresolver.add_to_cache("sprout.cw-ngv.com", ns_t_naptr, records);
+  records.push_back(ResolverUtils::naptr("asprout.cw-ngv.com", 3600, 0, 0, "s", "AAA+D2S", "", "_diameter._sctp.sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("asprout.cw-ngv.com", ns_t_naptr, records);
+
+  records.push_back(ResolverUtils::srv("_diameter._sctp.sprout-1.cw-ngv.com", 3600, 0, 0, 3868, "sprout-1.cw-ngv.com"));
+  _dnsresolver.add_to_cache("_diameter._sctp.sprout-1.cw-ngv.com", ns_t_srv, records);
+
+  records.push_back(ResolverUtils::a("sprout-1.cw-ngv.com", 3600, "3.0.0.1"));
+  _dnsresolver.add_to_cache("sprout-1.cw-ngv.com", ns_t_a, records);
+
+  int num_resolves = 1000 * BenchmarkUtils::scale();
+  int failures = 0;
+  uint64_t elapsed_ns;
+
+  BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_sequentially(
+    num_resolves,
+    [this, &failures] (int op) {
+      std::vector<AddrInfo> targets;
+      int ttl;
+      _diameterresolver.resolve("sprout.cw-ngv.com", "", 2, targets, ttl);
+
+      if (targets.empty())
+      {
+        failures++;
+      }
+    },
+    elapsed_ns);
+
+  EXPECT_EQ(0, failures);
+  stats.report("DiameterResolver NAPTR regex resolution", elapsed_ns);
+}
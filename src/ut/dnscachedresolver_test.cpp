@@ -13,12 +13,110 @@
 #include "gtest/gtest.h"
 #include "test_interposer.hpp"
 #include "test_utils.hpp"
+#include "benchmark_utils.hpp"
+#include "resolver_utils.h"
 #include "dnscachedresolver.h"
 #include "static_dns_cache.h"
 
 using namespace std;
 static std::string DNS_JSON_DIR = string(UT_DIR).append("/dns_json/");
 
+// Hex representation of a DNS response for abc-abc.abc.cw-ngv.com with two A
+// records with 300s TTL, both of which use a compressed name.
+static const unsigned char A_RESPONSE[] = {
+  0xf2, 0x6a, // Transaction ID
+  0x81, 0x80, // Flags (Standard Query Response, No error)
+  0x00, 0x01, // One Question
+  0x00, 0x02, // Two Answer RRs
+  0x00, 0x00, // Zero Authority RRs
+  0x00, 0x00, // Zero Additional RRs
+
+  // Query: for abc-abc.abc.cw-ngv.com
+  0x07, 0x61, 0x62, 0x63, 0x2d, 0x61, 0x62, 0x63, 0x03, 0x61, 0x62, 0x63,
+  0x06, 0x63, 0x77, 0x2d, 0x6e, 0x67, 0x76, 0x03, 0x63, 0x6f, 0x6d, 0x00,
+  0x00, 0x01, // Type A
+  0x00, 0x01, // Class IN
+
+  // Answer RR: pointer to the query name, 10.0.0.1
+  0xc0, 0x0c,
+  0x00, 0x01, // Type A
+  0x00, 0x01, // Class IN
+  0x00, 0x00, 0x01, 0x2c, // TTL: 300
+  0x00, 0x04, 0x0a, 0x00, 0x00, 0x01,
+
+  // Answer RR: pointer to the query name, 10.0.0.2
+  0xc0, 0x0c,
+  0x00, 0x01, // Type A
+  0x00, 0x01, // Class IN
+  0x00, 0x00, 0x01, 0x2c, // TTL: 300
+  0x00, 0x04, 0x0a, 0x00, 0x00, 0x02
+};
+
+// Hex representation of a DNS response for _sip._tcp.abc.cw-ngv.com with two
+// SRV records with 600s TTL. The owner names and the targets
+// (sprout-N.abc.cw-ngv.com) are all compressed.
+static const unsigned char SRV_RESPONSE[] = {
+  0xf2, 0x6a, // Transaction ID
+  0x81, 0x80, // Flags (Standard Query Response, No error)
+  0x00, 0x01, // One Question
+  0x00, 0x02, // Two Answer RRs
+  0x00, 0x00, // Zero Authority RRs
+  0x00, 0x00, // Zero Additional RRs
+
+  // Query: for _sip._tcp.abc.cw-ngv.com
+  0x04, 0x5f, 0x73, 0x69, 0x70, 0x04, 0x5f, 0x74, 0x63, 0x70, 0x03, 0x61,
+  0x62, 0x63, 0x06, 0x63, 0x77, 0x2d, 0x6e, 0x67, 0x76, 0x03, 0x63, 0x6f,
+  0x6d, 0x00,
+  0x00, 0x21, // Type SRV
+  0x00, 0x01, // Class IN
+
+  // Answer RR: pointer to the query name, 10 50 5054 sprout-1.abc.cw-ngv.com
+  0xc0, 0x0c,
+  0x00, 0x21, // Type SRV
+  0x00, 0x01, // Class IN
+  0x00, 0x00, 0x02, 0x58, // TTL: 600
+  0x00, 0x11, 0x00, 0x0a, 0x00, 0x32, 0x13, 0xbe,
+  0x08, 0x73, 0x70, 0x72, 0x6f, 0x75, 0x74, 0x2d, 0x31, 0xc0, 0x16,
+
+  // Answer RR: pointer to the query name, 10 50 5054 sprout-2.abc.cw-ngv.com
+  0xc0, 0x0c,
+  0x00, 0x21, // Type SRV
+  0x00, 0x01, // Class IN
+  0x00, 0x00, 0x02, 0x58, // TTL: 600
+  0x00, 0x11, 0x00, 0x0a, 0x00, 0x32, 0x13, 0xbe,
+  0x08, 0x73, 0x70, 0x72, 0x6f, 0x75, 0x74, 0x2d, 0x32, 0xc0, 0x16
+};
+
+// Hex representation of a DNS NXDOMAIN response for abc-abc.abc.cw-ngv.com
+// with an SOA giving a 60s TTL. This is the same response that NXDomainTTL
+// builds inline.
+static const unsigned char NXDOMAIN_RESPONSE[] = {
+  0xf2, 0x6a, // Transaction ID
+  0x81, 0x83, // Flags (Standard Query Response, No such name)
+  0x00, 0x01, // One Question
+  0x00, 0x00, // Zero Answer RRs
+  0x00, 0x01, // One Authority RR
+  0x00, 0x00, // Zero Additional RRs
+
+  // Query: for abc-abc.abc.cw-ngv.com
+  0x07, 0x61, 0x62, 0x63, 0x2d, 0x61, 0x62, 0x63, 0x03, 0x61, 0x62, 0x63,
+  0x06, 0x63, 0x77, 0x2d, 0x6e, 0x67, 0x76, 0x03, 0x63, 0x6f, 0x6d, 0x00,
+  0x00, 0x01, // Type A
+  0x00, 0x01, // Class IN
+
+  // Authority RR
+  0xc0, 0x18,
+  0x00, 0x06, // Type SOA
+  0x00, 0x01, // Class IN
+  0x00, 0x00, 0x00, 0x3c, // TTL: 60
+  0x00, 0x46, 0x07, 0x6e, 0x73, 0x2d, 0x31, 0x32, 0x37, 0x35, 0x09, 0x61,
+  0x77, 0x73, 0x64, 0x6e, 0x73, 0x2d, 0x33, 0x31, 0x03, 0x6f, 0x72, 0x67,
+  0x00, 0x11, 0x61, 0x77, 0x73, 0x64, 0x6e, 0x73, 0x2d, 0x68, 0x6f, 0x73,
+  0x74, 0x6d, 0x61, 0x73, 0x74, 0x65, 0x72, 0x06, 0x61, 0x6d, 0x61, 0x7a,
+  0x6f, 0x6e, 0xc0, 0x1f, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x1c, 0x20,
+  0x00, 0x00, 0x03, 0x84, 0x00, 0x12, 0x75, 0x00, 0x00, 0x01, 0x51, 0x80
+};
+
 std::vector<std::string> dns_servers = {"0.0.0.0"};
 // We don't test the DnsCachedResolver directly as we want to be able to
 // manually add entries to the DnsCache
@@ -284,3 +382,297 @@ TEST_F(DnsCachedResolverTest, NXDomainTTLMoreThan300)
   // Check that the cache entry has an expiry time of 300s from now
   ASSERT_EQ(time(NULL) + 300, ce->expires);
 }
+
+// Tests that a response containing compressed names is parsed into the
+// cache, with the expiry time taken from the record TTLs.
+TEST_F(DnsCachedResolverTest, AResponseParsed)
+{
+  std::string domain = "abc-abc.abc.cw-ngv.com";
+
+  SAS::TrailId no_trail = 0;
+  _resolver.create_cache_entry(domain, ns_t_a, no_trail);
+  std::shared_ptr<DnsCachedResolver::DnsCacheEntry> ce = _resolver.get_cache_entry(domain, ns_t_a);
+
+  _resolver.dns_response(domain, ns_t_a, ARES_SUCCESS,
+                         (unsigned char*)A_RESPONSE, sizeof(A_RESPONSE), 0);
+
+  ASSERT_EQ(time(NULL) + 300, ce->expires);
+
+  DnsResult result = _resolver.dns_query(domain, ns_t_a, 0);
+  EXPECT_EQ(result.domain(), domain);
+  EXPECT_EQ(result.records().size(), 2);
+}
+
+TEST_F(DnsCachedResolverTest, SRVResponseWithCompressedTargetsParsed)
+{
+  std::string domain = "_sip._tcp.abc.cw-ngv.com";
+
+  SAS::TrailId no_trail = 0;
+  _resolver.create_cache_entry(domain, ns_t_srv, no_trail);
+  std::shared_ptr<DnsCachedResolver::DnsCacheEntry> ce = _resolver.get_cache_entry(domain, ns_t_srv);
+
+  _resolver.dns_response(domain, ns_t_srv, ARES_SUCCESS,
+                         (unsigned char*)SRV_RESPONSE, sizeof(SRV_RESPONSE), 0);
+
+  ASSERT_EQ(time(NULL) + 600, ce->expires);
+
+  DnsResult result = _resolver.dns_query(domain, ns_t_srv, 0);
+  ASSERT_EQ(result.records().size(), 2);
+
+  // The targets should have been decompressed in full.
+  DnsSrvRecord* srv = dynamic_cast<DnsSrvRecord*>(result.records()[0]);
+  ASSERT_TRUE(srv != NULL);
+  EXPECT_THAT(srv->target(), ::testing::MatchesRegex("sprout-[12].abc.cw-ngv.com"));
+  EXPECT_EQ(5054, srv->port());
+}
+
+// Tests that once an NXDOMAIN response has been cached, repeated lookups of
+// that name are answered from the cache until the negative TTL expires.
+TEST_F(DnsCachedResolverTest, NXDomainServedFromCache)
+{
+  std::string domain = "abc-abc.abc.cw-ngv.com";
+
+  SAS::TrailId no_trail = 0;
+  _resolver.create_cache_entry(domain, ns_t_a, no_trail);
+  std::shared_ptr<DnsCachedResolver::DnsCacheEntry> ce = _resolver.get_cache_entry(domain, ns_t_a);
+
+  _resolver.dns_response(domain, ns_t_a, ARES_ENOTFOUND,
+                         (unsigned char*)NXDOMAIN_RESPONSE,
+                         sizeof(NXDOMAIN_RESPONSE), 0);
+  time_t expires = time(NULL) + 60;
+  ASSERT_EQ(expires, ce->expires);
+
+  for (int ii = 0; ii < 5; ++ii)
+  {
+    cwtest_advance_time_ms(10000);
+    DnsResult result = _resolver.dns_query(domain, ns_t_a, 0);
+    EXPECT_EQ(result.domain(), domain);
+    EXPECT_EQ(result.records().size(), 0);
+
+    // The entry should not have been refreshed.
+    EXPECT_EQ(expires, _resolver.get_cache_entry(domain, ns_t_a)->expires);
+  }
+}
+
+// An entry accessed in the last moments of its TTL should still be served
+// from the cache.
+TEST_F(DnsCachedResolverTest, EntryServedNearExpiry)
+{
+  std::string domain = "near.expiry.domain";
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::a(domain, 60, "3.0.0.1"));
+  _resolver.add_to_cache(domain, ns_t_a, records);
+
+  cwtest_advance_time_ms(59000);
+
+  DnsResult result = _resolver.dns_query(domain, ns_t_a, 0);
+  EXPECT_EQ(result.domain(), domain);
+  EXPECT_EQ(result.records().size(), 1);
+}
+
+// Refreshing an entry before it expires should replace its records and push
+// its expiry time out, so that the refreshed records are served past the
+// original expiry time.
+TEST_F(DnsCachedResolverTest, EntryRefreshedBeforeExpiry)
+{
+  std::string domain = "refreshed.domain";
+  std::vector<DnsRRecord*> records;
+  records.push_back(ResolverUtils::a(domain, 60, "3.0.0.1"));
+  _resolver.add_to_cache(domain, ns_t_a, records);
+
+  // Refresh the entry with two records when it's in the last 20% of its TTL.
+  cwtest_advance_time_ms(50000);
+  records.push_back(ResolverUtils::a(domain, 60, "3.0.0.1"));
+  records.push_back(ResolverUtils::a(domain, 60, "3.0.0.2"));
+  _resolver.add_to_cache(domain, ns_t_a, records);
+
+  // Move past the original expiry time. The refreshed records should be
+  // returned.
+  cwtest_advance_time_ms(30000);
+
+  DnsResult result = _resolver.dns_query(domain, ns_t_a, 0);
+  EXPECT_EQ(result.domain(), domain);
+  EXPECT_EQ(result.records().size(), 2);
+}
+
+// Lookups from many threads should see consistent results while other threads
+// add unrelated entries to the cache.
+TEST_F(DnsCachedResolverTest, ConcurrentLookupsAndInserts)
+{
+  const int NUM_READERS = 8;
+  const int NUM_LOOKUPS = 500;
+  const int NUM_INSERTS = 200;
+
+  std::atomic_int mismatches(0);
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < NUM_READERS; ++ii)
+  {
+    threads.push_back(std::thread([this, &mismatches] () {
+      for (int jj = 0; jj < NUM_LOOKUPS; ++jj)
+      {
+        DnsResult result = _resolver.dns_query("one.made.up.domain", ns_t_a, 0);
+
+        if ((result.domain() != "one.made.up.domain") ||
+            (result.records().size() != 1))
+        {
+          mismatches++;
+        }
+      }
+    }));
+  }
+
+  threads.push_back(std::thread([this] () {
+    for (int jj = 0; jj < NUM_INSERTS; ++jj)
+    {
+      std::string domain = "inserted-" + std::to_string(jj) + ".made.up.domain";
+      std::vector<DnsRRecord*> records;
+      records.push_back(ResolverUtils::a(domain, 3600, "3.0.0.1"));
+      _resolver.add_to_cache(domain, ns_t_a, records);
+    }
+  }));
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, mismatches.load());
+
+  // Every inserted entry should be in the cache.
+  for (int jj = 0; jj < NUM_INSERTS; ++jj)
+  {
+    std::string domain = "inserted-" + std::to_string(jj) + ".made.up.domain";
+    EXPECT_EQ(1, _resolver.dns_query(domain, ns_t_a, 0).records().size());
+  }
+}
+
+/// Fixture for DnsCachedResolver benchmarks. The cache is filled directly, and
+/// the resolver has no server to query.
+class DnsCachedResolverBenchmark : public ::testing::Test
+{
+public:
+  static const int NUM_DOMAINS = 1000;
+
+  DnsCachedResolverBenchmark() :
+    _resolver("0.0.0.0")
+  {
+  }
+
+  static std::string domain(int index)
+  {
+    return "host-" + std::to_string(index) + ".bench.cw-ngv.com";
+  }
+
+  /// Adds NUM_DOMAINS A record entries to the cache, each with two records.
+  void populate_cache()
+  {
+    for (int ii = 0; ii < NUM_DOMAINS; ++ii)
+    {
+      std::vector<DnsRRecord*> records;
+      records.push_back(ResolverUtils::a(domain(ii), 3600, "3.0.0.1"));
+      records.push_back(ResolverUtils::a(domain(ii), 3600, "3.0.0.2"));
+      _resolver.add_to_cache(domain(ii), ns_t_a, records);
+    }
+  }
+
+  DnsCachedResolver _resolver;
+};
+
+// Measures the rate at which threads can look up unexpired entries in a
+// pre-populated cache, for increasing numbers of threads.
+TEST_F(DnsCachedResolverBenchmark, CachedLookups)
+{
+  populate_cache();
+
+  BenchmarkUtils::run_at_concurrencies(
+    "DnsCachedResolver cached lookups",
+    {1, 4, 16},
+    1000 * BenchmarkUtils::scale(),
+    [this] (int thread, int op) {
+      // Spread each thread's lookups over the whole cache, starting at a
+      // different point in each thread.
+      int index = ((thread * 7919) + op) % NUM_DOMAINS;
+      return (_resolver.dns_query(domain(index), ns_t_a, 0).records().size() == 2);
+    });
+}
+
+// Measures the cost of filling an empty cache, which is what a node pays to
+// warm its cache after a restart.
+TEST_F(DnsCachedResolverBenchmark, PopulateCache)
+{
+  int num_entries = NUM_DOMAINS * BenchmarkUtils::scale();
+  uint64_t elapsed_ns;
+
+  BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_sequentially(
+    num_entries,
+    [this] (int op) {
+      std::vector<DnsRRecord*> records;
+      records.push_back(ResolverUtils::a(domain(op), 3600, "3.0.0.1"));
+      records.push_back(ResolverUtils::a(domain(op), 3600, "3.0.0.2"));
+      _resolver.add_to_cache(domain(op), ns_t_a, records);
+    },
+    elapsed_ns);
+
+  stats.report("DnsCachedResolver populate " + std::to_string(num_entries) +
+                 " entries",
+               elapsed_ns);
+
+  // Everything added should now be served from the cache.
+  EXPECT_EQ(2, _resolver.dns_query(domain(0), ns_t_a, 0).records().size());
+  EXPECT_EQ(2, _resolver.dns_query(domain(num_entries - 1), ns_t_a, 0).records().size());
+}
+
+// Measures the rate at which captured DNS responses are parsed into the cache.
+TEST_F(DnsCachedResolverBenchmark, ParseResponses)
+{
+  int num_responses = 10000 * BenchmarkUtils::scale();
+  SAS::TrailId no_trail = 0;
+
+  std::string a_domain = "abc-abc.abc.cw-ngv.com";
+  std::string srv_domain = "_sip._tcp.abc.cw-ngv.com";
+  _resolver.create_cache_entry(a_domain, ns_t_a, no_trail);
+  _resolver.create_cache_entry(srv_domain, ns_t_srv, no_trail);
+
+  uint64_t elapsed_ns;
+  BenchmarkUtils::LatencyStats a_stats = BenchmarkUtils::run_sequentially(
+    num_responses,
+    [this, &a_domain] (int op) {
+      _resolver.dns_response(a_domain, ns_t_a, ARES_SUCCESS,
+                             (unsigned char*)A_RESPONSE, sizeof(A_RESPONSE), 0);
+    },
+    elapsed_ns);
+  a_stats.report("DnsCachedResolver parse A responses", elapsed_ns);
+
+  BenchmarkUtils::LatencyStats srv_stats = BenchmarkUtils::run_sequentially(
+    num_responses,
+    [this, &srv_domain] (int op) {
+      _resolver.dns_response(srv_domain, ns_t_srv, ARES_SUCCESS,
+                             (unsigned char*)SRV_RESPONSE, sizeof(SRV_RESPONSE), 0);
+    },
+    elapsed_ns);
+  srv_stats.report("DnsCachedResolver parse SRV responses", elapsed_ns);
+
+  EXPECT_EQ(2, _resolver.dns_query(a_domain, ns_t_a, 0).records().size());
+  EXPECT_EQ(2, _resolver.dns_query(srv_domain, ns_t_srv, 0).records().size());
+}
+
+// Measures the rate at which threads can look up a name whose NXDOMAIN
+// response is cached, as misconfigured peers cause us to do.
+TEST_F(DnsCachedResolverBenchmark, NegativeLookups)
+{
+  std::string domain = "abc-abc.abc.cw-ngv.com";
+  SAS::TrailId no_trail = 0;
+  _resolver.create_cache_entry(domain, ns_t_a, no_trail);
+  _resolver.dns_response(domain, ns_t_a, ARES_ENOTFOUND,
+                         (unsigned char*)NXDOMAIN_RESPONSE,
+                         sizeof(NXDOMAIN_RESPONSE), 0);
+
+  BenchmarkUtils::run_at_concurrencies(
+    "DnsCachedResolver NXDOMAIN lookups",
+    {1, 4, 16},
+    1000 * BenchmarkUtils::scale(),
+    [this, &domain] (int thread, int op) {
+      return _resolver.dns_query(domain, ns_t_a, 0).records().empty();
+    });
+}
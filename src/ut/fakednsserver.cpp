@@ -0,0 +1,379 @@
+/**
+ * @file fakednsserver.cpp In-process fake DNS server (for testing).
+ *
+ * Copyright (C) Metaswitch Networks 2019
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "fakednsserver.hpp"
+
+/// Size of the DNS message header.
+static const int HEADER_LEN = 12;
+
+/// How often the server thread wakes up to check for pending responses and
+/// termination.
+static const int POLL_INTERVAL_MS = 5;
+
+FakeDnsServer::FakeDnsServer() :
+  _fd(-1),
+  _port(-1),
+  _terminate(false),
+  _has_default_a(false),
+  _delay_ms(0),
+  _loss_percent(0),
+  _query_count(0),
+  _seed(1)
+{
+  _fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if (_fd < 0)
+  {
+    printf("FakeDnsServer failed to create socket: %s\n", strerror(errno));
+    return;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+  socklen_t addr_len = sizeof(addr);
+
+  if ((bind(_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+      (getsockname(_fd, (struct sockaddr*)&addr, &addr_len) < 0))
+  {
+    printf("FakeDnsServer failed to bind socket: %s\n", strerror(errno));
+    close(_fd); _fd = -1;
+    return;
+  }
+
+  _port = ntohs(addr.sin_port);
+}
+
+FakeDnsServer::~FakeDnsServer()
+{
+  stop();
+
+  if (_fd >= 0)
+  {
+    close(_fd); _fd = -1;
+  }
+}
+
+void FakeDnsServer::start()
+{
+  if ((_fd >= 0) && (!_thread.joinable()))
+  {
+    _terminate.store(false);
+    _thread = std::thread(&FakeDnsServer::run, this);
+  }
+}
+
+void FakeDnsServer::stop()
+{
+  if (_thread.joinable())
+  {
+    _terminate.store(true);
+    _thread.join();
+  }
+}
+
+void FakeDnsServer::add_a(const std::string& name, int ttl, const std::string& address)
+{
+  struct in_addr addr;
+  inet_pton(AF_INET, address.c_str(), &addr);
+  add_record(name, ns_t_a, ttl, std::string((char*)&addr, sizeof(addr)));
+}
+
+void FakeDnsServer::add_aaaa(const std::string& name, int ttl, const std::string& address)
+{
+  struct in6_addr addr;
+  inet_pton(AF_INET6, address.c_str(), &addr);
+  add_record(name, ns_t_aaaa, ttl, std::string((char*)&addr, sizeof(addr)));
+}
+
+void FakeDnsServer::add_srv(const std::string& name,
+                            int ttl,
+                            int priority,
+                            int weight,
+                            int port,
+                            const std::string& target)
+{
+  std::string rdata = encode_u16(priority) +
+                      encode_u16(weight) +
+                      encode_u16(port) +
+                      encode_name(target);
+  add_record(name, ns_t_srv, ttl, rdata);
+}
+
+void FakeDnsServer::add_naptr(const std::string& name,
+                              int ttl,
+                              int order,
+                              int preference,
+                              const std::string& flags,
+                              const std::string& service,
+                              const std::string& regex,
+                              const std::string& replacement)
+{
+  std::string rdata = encode_u16(order) +
+                      encode_u16(preference) +
+                      encode_string(flags) +
+                      encode_string(service) +
+                      encode_string(regex) +
+                      encode_name(replacement);
+  add_record(name, ns_t_naptr, ttl, rdata);
+}
+
+void FakeDnsServer::set_default_a(int ttl, const std::string& address)
+{
+  struct in_addr addr;
+  inet_pton(AF_INET, address.c_str(), &addr);
+
+  std::lock_guard<std::mutex> lock(_records_lock);
+  _has_default_a = true;
+  _default_a.ttl = ttl;
+  _default_a.rdata = std::string((char*)&addr, sizeof(addr));
+}
+
+void FakeDnsServer::add_record(const std::string& name,
+                               int rrtype,
+                               int ttl,
+                               const std::string& rdata)
+{
+  std::string key_name = name;
+  std::transform(key_name.begin(), key_name.end(), key_name.begin(), ::tolower);
+
+  Record record;
+  record.ttl = ttl;
+  record.rdata = rdata;
+
+  std::lock_guard<std::mutex> lock(_records_lock);
+  _records[RecordKey(key_name, rrtype)].push_back(record);
+}
+
+void FakeDnsServer::run()
+{
+  unsigned char buf[1024];
+
+  while (!_terminate.load())
+  {
+    // Work out how long we can wait for a query before the next pending
+    // response is due.
+    uint64_t now = now_ms();
+    int timeout_ms = POLL_INTERVAL_MS;
+
+    for (const PendingResponse& pending : _pending)
+    {
+      int due_ms = (pending.send_time_ms > now) ? (pending.send_time_ms - now) : 0;
+      timeout_ms = std::min(timeout_ms, due_ms);
+    }
+
+    struct pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if ((poll(&pfd, 1, timeout_ms) > 0) && (pfd.revents & POLLIN))
+    {
+      PendingResponse pending;
+      pending.addr_len = sizeof(pending.addr);
+      ssize_t len = recvfrom(_fd,
+                             buf,
+                             sizeof(buf),
+                             0,
+                             (struct sockaddr*)&pending.addr,
+                             &pending.addr_len);
+
+      if (len > 0)
+      {
+        _query_count++;
+
+        if ((int)(rand_r(&_seed) % 100) < _loss_percent.load())
+        {
+          // Drop the query on the floor.
+        }
+        else if (build_response(buf, len, pending.response))
+        {
+          pending.send_time_ms = now_ms() + _delay_ms.load();
+          _pending.push_back(pending);
+        }
+      }
+    }
+
+    // Send any responses that are due.
+    now = now_ms();
+    std::list<PendingResponse>::iterator it = _pending.begin();
+
+    while (it != _pending.end())
+    {
+      if (it->send_time_ms <= now)
+      {
+        sendto(_fd,
+               it->response.data(),
+               it->response.size(),
+               0,
+               (struct sockaddr*)&it->addr,
+               it->addr_len);
+        it = _pending.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+  _pending.clear();
+}
+
+bool FakeDnsServer::build_response(const unsigned char* query,
+                                   int len,
+                                   std::string& response)
+{
+  if (len < HEADER_LEN)
+  {
+    return false;
+  }
+
+  // Parse the (uncompressed) name from the question.
+  std::string name;
+  int offset = HEADER_LEN;
+
+  while ((offset < len) && (query[offset] != 0))
+  {
+    int label_len = query[offset];
+
+    if ((label_len > 63) || (offset + 1 + label_len >= len))
+    {
+      return false;
+    }
+
+    if (!name.empty())
+    {
+      name += ".";
+    }
+
+    name.append((const char*)&query[offset + 1], label_len);
+    offset += 1 + label_len;
+  }
+
+  // Skip the terminating zero length label, then read the type and class.
+  offset += 1;
+
+  if (offset + 4 > len)
+  {
+    return false;
+  }
+
+  int rrtype = (query[offset] << 8) | query[offset + 1];
+  int question_end = offset + 4;
+
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+  std::vector<Record> answers;
+  {
+    std::lock_guard<std::mutex> lock(_records_lock);
+    std::map<RecordKey, std::vector<Record>>::const_iterator records =
+      _records.find(RecordKey(name, rrtype));
+
+    if (records != _records.end())
+    {
+      answers = records->second;
+    }
+    else if ((rrtype == ns_t_a) && (_has_default_a))
+    {
+      answers.push_back(_default_a);
+    }
+  }
+
+  // Header. Echo the query ID and the RD flag, and set QR and RA. If there are
+  // no answers, respond with NXDOMAIN.
+  response.clear();
+  response.append((const char*)query, 2);
+  response += (char)(0x80 | (query[2] & 0x01));
+  response += (char)(answers.empty() ? 0x83 : 0x80);
+  response += encode_u16(1);
+  response += encode_u16(answers.size());
+  response += encode_u16(0);
+  response += encode_u16(0);
+
+  // Echo the question.
+  response.append((const char*)&query[HEADER_LEN], question_end - HEADER_LEN);
+
+  // Each answer's owner name is a pointer to the name in the question.
+  for (const Record& answer : answers)
+  {
+    response += encode_u16(0xc000 | HEADER_LEN);
+    response += encode_u16(rrtype);
+    response += encode_u16(ns_c_in);
+    response += encode_u32(answer.ttl);
+    response += encode_u16(answer.rdata.size());
+    response += answer.rdata;
+  }
+
+  return true;
+}
+
+std::string FakeDnsServer::encode_name(const std::string& name)
+{
+  std::string encoded;
+  size_t start = 0;
+
+  while (start < name.size())
+  {
+    size_t end = name.find('.', start);
+
+    if (end == std::string::npos)
+    {
+      end = name.size();
+    }
+
+    encoded += encode_string(name.substr(start, end - start));
+    start = end + 1;
+  }
+
+  encoded += (char)0;
+  return encoded;
+}
+
+std::string FakeDnsServer::encode_string(const std::string& str)
+{
+  return (char)str.size() + str;
+}
+
+std::string FakeDnsServer::encode_u16(uint16_t value)
+{
+  std::string encoded;
+  encoded += (char)(value >> 8);
+  encoded += (char)(value & 0xff);
+  return encoded;
+}
+
+std::string FakeDnsServer::encode_u32(uint32_t value)
+{
+  return encode_u16(value >> 16) + encode_u16(value & 0xffff);
+}
+
+uint64_t FakeDnsServer::now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file fakednsserver.hpp In-process fake DNS server (for testing).
+ *
+ * Copyright (C) Metaswitch Networks 2019
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef FAKEDNSSERVER_H__
+#define FAKEDNSSERVER_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// A DNS server that answers UDP queries on the loopback interface from a
+/// script of canned records. It runs on its own thread, and can be told to
+/// delay or drop responses so that resolvers can be driven under realistic
+/// conditions.
+///
+/// Names that have no records of the queried type get an NXDOMAIN response,
+/// unless a default A record has been set, in which case A queries for any
+/// name are answered with it.
+class FakeDnsServer
+{
+public:
+  /// Binds the server to an ephemeral port on 127.0.0.1. Call start() to
+  /// begin answering queries.
+  FakeDnsServer();
+  virtual ~FakeDnsServer();
+
+  void start();
+  void stop();
+
+  /// Returns the port that the server is listening on.
+  int port() const { return _port; }
+
+  void add_a(const std::string& name, int ttl, const std::string& address);
+  void add_aaaa(const std::string& name, int ttl, const std::string& address);
+  void add_srv(const std::string& name,
+               int ttl,
+               int priority,
+               int weight,
+               int port,
+               const std::string& target);
+  void add_naptr(const std::string& name,
+                 int ttl,
+                 int order,
+                 int preference,
+                 const std::string& flags,
+                 const std::string& service,
+                 const std::string& regex,
+                 const std::string& replacement);
+
+  /// Answers A queries for names with no other records with this address.
+  void set_default_a(int ttl, const std::string& address);
+
+  /// Delays every response by the given time.
+  void set_delay_ms(int delay_ms) { _delay_ms = delay_ms; }
+
+  /// Drops the given percentage of queries without responding.
+  void set_loss_percent(int loss_percent) { _loss_percent = loss_percent; }
+
+  /// Returns the number of queries received (including dropped ones).
+  int query_count() const { return _query_count; }
+
+private:
+  /// A resource record, with its RDATA already in wire format.
+  struct Record
+  {
+    int ttl;
+    std::string rdata;
+  };
+
+  /// A response waiting to be sent.
+  struct PendingResponse
+  {
+    uint64_t send_time_ms;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    std::string response;
+  };
+
+  typedef std::pair<std::string, int> RecordKey;
+
+  void add_record(const std::string& name, int rrtype, int ttl, const std::string& rdata);
+  void run();
+
+  /// Builds the response to a query. Returns false if the query can't be
+  /// parsed, in which case no response should be sent.
+  bool build_response(const unsigned char* query, int len, std::string& response);
+
+  static std::string encode_name(const std::string& name);
+  static std::string encode_string(const std::string& str);
+  static std::string encode_u16(uint16_t value);
+  static std::string encode_u32(uint32_t value);
+  static uint64_t now_ms();
+
+  int _fd;
+  int _port;
+  std::thread _thread;
+  std::atomic_bool _terminate;
+
+  std::mutex _records_lock;
+  std::map<RecordKey, std::vector<Record>> _records;
+  bool _has_default_a;
+  Record _default_a;
+
+  std::atomic_int _delay_ms;
+  std::atomic_int _loss_percent;
+  std::atomic_int _query_count;
+
+  // Only accessed on the server thread.
+  std::list<PendingResponse> _pending;
+  unsigned int _seed;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file fakednsserver_test.cpp UT for resolving against the fake DNS server.
+ *
+ * Copyright (C) Metaswitch Networks 2019
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "dnscachedresolver.h"
+#include "fakednsserver.hpp"
+
+/// Fixture for tests that resolve against a FakeDnsServer. The resolver
+/// queries the server over UDP on the loopback interface, so these tests use
+/// the real clock.
+class FakeDnsServerTest : public ::testing::Test
+{
+  FakeDnsServer _server;
+
+  FakeDnsServerTest()
+  {
+    _server.start();
+  }
+
+  virtual ~FakeDnsServerTest()
+  {
+    _server.stop();
+  }
+
+  virtual void SetUp() override
+  {
+    // The server only logs if it fails to bind, so check here rather than
+    // letting the resolvers time out querying port -1.
+    ASSERT_GT(_server.port(), 0);
+  }
+
+  /// Creates a resolver that queries the fake server.
+  DnsCachedResolver* create_resolver(int timeout_ms = DnsCachedResolver::DEFAULT_TIMEOUT)
+  {
+    std::vector<std::string> servers = {"127.0.0.1"};
+    return new DnsCachedResolver(servers, timeout_ms, "", _server.port());
+  }
+};
+
+// Checks that A records served by the fake server are parsed and cached.
+TEST_F(FakeDnsServerTest, ARecord)
+{
+  _server.add_a("sprout.cw-ngv.com", 300, "3.0.0.1");
+  _server.add_a("sprout.cw-ngv.com", 300, "3.0.0.2");
+
+  DnsCachedResolver* resolver = create_resolver();
+  DnsResult result = resolver->dns_query("sprout.cw-ngv.com", ns_t_a, 0);
+
+  EXPECT_EQ("sprout.cw-ngv.com", result.domain());
+  ASSERT_EQ(2u, result.records().size());
+  EXPECT_EQ(300, result.ttl());
+
+  // A second lookup is served from the cache.
+  resolver->dns_query("sprout.cw-ngv.com", ns_t_a, 0);
+  EXPECT_EQ(1, _server.query_count());
+
+  delete resolver; resolver = NULL;
+}
+
+// Checks that names with no records get no results.
+TEST_F(FakeDnsServerTest, NXDomain)
+{
+  DnsCachedResolver* resolver = create_resolver();
+  DnsResult result = resolver->dns_query("unknown.cw-ngv.com", ns_t_a, 0);
+
+  EXPECT_EQ(0u, result.records().size());
+  EXPECT_EQ(1, _server.query_count());
+
+  delete resolver; resolver = NULL;
+}
+
+// Checks that when many threads miss on the same name at once, as happens when
+// a popular entry expires, only one query goes to the server and every thread
+// gets its answer.
+TEST_F(FakeDnsServerTest, ConcurrentMissesOnSameDomain)
+{
+  const int NUM_THREADS = 20;
+  _server.add_a("herd.cw-ngv.com", 300, "3.0.0.1");
+
+  // Delay the response so that the other threads miss while the first query
+  // is outstanding. Threads that arrive after the response is cached don't
+  // query either, so the count doesn't depend on how the threads are
+  // scheduled. The resolver's timeout is far above the delay, so the query
+  // is not retried even when the test runs slowly (e.g. under valgrind).
+  _server.set_delay_ms(100);
+  DnsCachedResolver* resolver = create_resolver(10000);
+
+  std::atomic_int failures(0);
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < NUM_THREADS; ++ii)
+  {
+    threads.push_back(std::thread([resolver, &failures] () {
+      DnsResult result = resolver->dns_query("herd.cw-ngv.com", ns_t_a, 0);
+
+      if (result.records().size() != 1)
+      {
+        failures++;
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, failures.load());
+  EXPECT_EQ(1, _server.query_count());
+
+  delete resolver; resolver = NULL;
+}
@@ -30,6 +30,7 @@
 #include "curl_interposer.hpp"
 #include "fakecurl.hpp"
 #include "test_interposer.hpp"
+#include "benchmark_utils.hpp"
 
 using namespace std;
 using ::testing::MatchesRegex;
@@ -329,6 +330,40 @@ TEST_F(HttpClientTest, SimpleGetRetry)
   EXPECT_EQ("<message>Test message</message>", response);
 }
 
+// Test that a retried request uses the client's configured timeout, rather
+// than anything derived from how the first attempt went.
+TEST_F(HttpClientTest, RetryUsesConfiguredTimeout)
+{
+  std::string response;
+
+  long ret = _http->send_request(HttpClient::RequestType::GET,
+                                 "http://cyrus:80/test/get_with_retry",
+                                 default_body,
+                                 response,
+                                 default_username,
+                                 default_sas_trail,
+                                 default_req_headers,
+                                 &default_resp_headers,
+                                 default_host_state);
+
+  EXPECT_EQ(200, ret);
+  EXPECT_EQ(550, fakecurl_requests["http://cyrus:80/test/get_with_retry"]._timeout_ms);
+
+  fakecurl_requests.clear();
+  ret = _alt_http->send_request(HttpClient::RequestType::GET,
+                                "http://cyrus:80/test/get_with_retry",
+                                default_body,
+                                response,
+                                default_username,
+                                default_sas_trail,
+                                default_req_headers,
+                                &default_resp_headers,
+                                default_host_state);
+
+  EXPECT_EQ(200, ret);
+  EXPECT_EQ(1000, fakecurl_requests["http://cyrus:80/test/get_with_retry"]._timeout_ms);
+}
+
 // Test that we incur a penalty for a single 504, and do not retry
 TEST_F(HttpClientTest, Get504)
 {
@@ -413,6 +448,29 @@ TEST_F(HttpClientTest, SimplePostWithBody)
   EXPECT_EQ("Test body", req._body);
 }
 
+// Test that large request and response bodies are passed through intact.
+TEST_F(HttpClientTest, LargeBodies)
+{
+  std::string request_body(100 * 1024, 'q');
+  std::string response_body(100 * 1024, 'r');
+  fakecurl_responses["http://10.42.42.42:80/large"] = response_body;
+  std::string response;
+
+  long ret = _http->send_request(HttpClient::RequestType::POST,
+                                 "http://cyrus:80/large",
+                                 request_body,
+                                 response,
+                                 default_username,
+                                 default_sas_trail,
+                                 default_req_headers,
+                                 &default_resp_headers,
+                                 default_host_state);
+
+  EXPECT_EQ(200, ret);
+  EXPECT_EQ(response_body, response);
+  EXPECT_EQ(request_body, fakecurl_requests["http://cyrus:80/large"]._body);
+}
+
 // Test a post with multiple headers to send actually sends them all
 TEST_F(HttpClientTest, SimplePostWithHeaders)
 {
@@ -1007,3 +1065,78 @@ TEST_F(HttpClientBlacklistTest, BlacklistTestAllFailure)
                       default_host_state);
 
 }
+
+// Test that when every target fails, the communication monitor is told about
+// a single failure for the request as a whole rather than one per target.
+TEST_F(HttpClientBlacklistTest, BlacklistTestAllFailureInformsCommMonitorOnce)
+{
+  std::vector<AddrInfo> targets = create_targets(2);
+
+  EXPECT_CALL(_resolver, resolve_iter(_,_,_,_)).
+    WillOnce(Return(new SimpleAddrIterator(targets)));
+  EXPECT_CALL(_resolver, blacklist(targets[0])).Times(1);
+  EXPECT_CALL(_resolver, blacklist(targets[1])).Times(1);
+  EXPECT_CALL(*_cm, inform_failure(_)).Times(1);
+  EXPECT_CALL(*_cm, inform_success(_)).Times(0);
+
+  long ret = _http->send_request(HttpClient::RequestType::GET,
+                                 "http://cyrus/all_failure",
+                                 default_body,
+                                 default_response,
+                                 default_username,
+                                 default_sas_trail,
+                                 default_req_headers,
+                                 &default_resp_headers,
+                                 default_host_state);
+
+  EXPECT_NE(200, ret);
+}
+
+/// Fixture for HttpClient benchmarks. Requests go through fakecurl, so these
+/// measure the cost of HttpClient's own processing (building the request,
+/// copying bodies, SAS logging) rather than the network.
+class HttpClientBenchmark : public HttpClientTest
+{
+  static const int BODY_SIZE = 100 * 1024;
+
+  std::string _body;
+
+  HttpClientBenchmark() :
+    _body(BODY_SIZE, 'x')
+  {
+    fakecurl_responses["http://10.42.42.42:80/large"] = _body;
+  }
+};
+
+// Measures POSTs with a 100KB request body and a 100KB response body, as seen
+// with XML user data. fakecurl isn't thread-safe, so this is single threaded.
+TEST_F(HttpClientBenchmark, LargeBodies)
+{
+  int num_requests = 100 * BenchmarkUtils::scale();
+  int failures = 0;
+  uint64_t elapsed_ns;
+
+  BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_sequentially(
+    num_requests,
+    [this, &failures] (int op) {
+      std::string response;
+      long ret = _http->send_request(HttpClient::RequestType::POST,
+                                     "http://cyrus:80/large",
+                                     _body,
+                                     response,
+                                     default_username,
+                                     default_sas_trail,
+                                     default_req_headers,
+                                     &default_resp_headers,
+                                     default_host_state);
+
+      if ((ret != 200) || ((int)response.size() != BODY_SIZE))
+      {
+        failures++;
+      }
+    },
+    elapsed_ns);
+
+  EXPECT_EQ(0, failures);
+  stats.report("HttpClient 100KB POST", elapsed_ns);
+}
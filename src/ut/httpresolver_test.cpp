@@ -10,6 +10,9 @@
  */
 
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -154,3 +157,56 @@ TEST_F(HttpResolverTest, ResolutionFailure)
   // Fail to resolve
   EXPECT_EQ(0, resolve(1, "cpp-common-test.cw-ngv.com", 0).size());
 }
+
+// Resolution is done on worker threads, so many threads must be able to
+// resolve through the same HttpResolver while others update the blacklist.
+// Half of the threads keep blacklisting a target, which rewrites its entry,
+// while the other half resolve. The resolving threads should always get the
+// four white targets and never the blacklisted one.
+TEST_F(HttpResolverTest, ConcurrentResolution)
+{
+  const int NUM_THREADS = 8;
+  const int NUM_RESOLVES = 200;
+
+  add_white_records(5);
+  AddrInfo black_target = ip_to_addr_info("3.0.0.0");
+  _httpresolver.blacklist(black_target);
+
+  std::atomic_int mismatches(0);
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < NUM_THREADS; ++ii)
+  {
+    if (ii % 2 == 0)
+    {
+      threads.push_back(std::thread([this, &black_target] () {
+        for (int jj = 0; jj < NUM_RESOLVES; ++jj)
+        {
+          _httpresolver.blacklist(black_target);
+        }
+      }));
+    }
+    else
+    {
+      threads.push_back(std::thread([this, &black_target, &mismatches] () {
+        for (int jj = 0; jj < NUM_RESOLVES; ++jj)
+        {
+          std::vector<AddrInfo> targets = resolve(4);
+
+          if ((targets.size() != 4) ||
+              (std::find(targets.begin(), targets.end(), black_target) != targets.end()))
+          {
+            mismatches++;
+          }
+        }
+      }));
+    }
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, mismatches.load());
+}
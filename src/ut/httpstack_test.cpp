@@ -15,14 +15,19 @@
 
 #include "httpstack.h"
 
+#include "load_monitor.h"
 #include "mockloadmonitor.hpp"
 #include "fakesimplestatsmanager.hpp"
 #include "mock_sas.h"
+#include "benchmark_utils.hpp"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <thread>
+
 using ::testing::Return;
 using ::testing::StrictMock;
 using ::testing::_;
@@ -78,11 +83,26 @@ public:
           std::string& response,
           std::list<std::string>* headers=NULL,
           std::string body = "")
+  {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    int rc = perform(path, status, response, headers, body);
+    curl_global_cleanup();
+
+    return rc;
+  }
+
+  // Sends a single request to the stack. Unlike get(), this doesn't initialize
+  // curl globally, so it can be called from several threads at once as long as
+  // the caller has called curl_global_init.
+  int perform(const std::string& path,
+              int& status,
+              std::string& response,
+              std::list<std::string>* headers=NULL,
+              std::string body = "")
   {
     std::string url = _url_prefix + path;
     struct curl_slist *extra_headers = NULL;
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
     CURL* curl = curl_easy_init();
 
     char errbuf[CURL_ERROR_SIZE];
@@ -128,7 +148,6 @@ public:
 
     curl_slist_free_all(extra_headers);
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
 
     return (int)rc;
   }
@@ -233,6 +252,31 @@ public:
   }
 };
 
+// A handler that builds a large response from many calls to add_content.
+const int LARGE_RESPONSE_CHUNKS = 1024;
+const int LARGE_RESPONSE_CHUNK_SIZE = 1024;
+
+class LargeResponseHandler : public HttpStack::HandlerInterface
+{
+public:
+  void process_request(HttpStack::Request &req, SAS::TrailId trail)
+  {
+    for (int ii = 0; ii < LARGE_RESPONSE_CHUNKS; ++ii)
+    {
+      req.add_content(chunk(ii));
+    }
+
+    req.send_reply(200, trail);
+  }
+
+  // Returns the contents of a chunk. Each chunk is different, so that the
+  // test can spot chunks that have been reordered or lost.
+  static std::string chunk(int index)
+  {
+    return std::string(LARGE_RESPONSE_CHUNK_SIZE, 'a' + (index % 26));
+  }
+};
+
 // A handler which omits the body of requests in SAS logs.
 class PrivateHandler : public HttpStack::HandlerInterface
 {
@@ -354,6 +398,30 @@ TEST_F(HttpStackTest, DefaultHandler)
   stop_stack();
 }
 
+// Check that a large response built up from many pieces arrives intact.
+TEST_F(HttpStackTest, LargeResponse)
+{
+  start_stack();
+
+  LargeResponseHandler handler;
+  _stack->register_handler("^/LargeResponseHandler$", &handler);
+
+  int status;
+  std::string response;
+  int rc = get("/LargeResponseHandler", status, response);
+  ASSERT_EQ(CURLE_OK, rc);
+  ASSERT_EQ(200, status);
+  ASSERT_EQ((size_t)(LARGE_RESPONSE_CHUNKS * LARGE_RESPONSE_CHUNK_SIZE), response.size());
+
+  for (int ii = 0; ii < LARGE_RESPONSE_CHUNKS; ++ii)
+  {
+    ASSERT_EQ(LargeResponseHandler::chunk(ii),
+              response.substr(ii * LARGE_RESPONSE_CHUNK_SIZE, LARGE_RESPONSE_CHUNK_SIZE));
+  }
+
+  stop_stack();
+}
+
 // Check that the stack copes with receiving a SAS correlation header.
 TEST_F(HttpStackTest, SASCorrelationHeader)
 {
@@ -678,3 +746,251 @@ TEST_F(HttpStackStatsTest, LatencyPenalties)
 
   stop_stack();
 }
+
+// Check that requests arriving on several connections at once are all handled,
+// and that the stats count every one of them.
+TEST_F(HttpStackStatsTest, ConcurrentRequests)
+{
+  const int num_threads = 4;
+  const int requests_per_thread = 25;
+  const int num_requests = num_threads * requests_per_thread;
+
+  start_stack();
+
+  BasicHandler handler;
+  _stack->register_handler("^/BasicHandler$", &handler);
+
+  EXPECT_CALL(_load_monitor, admit_request(_, _)).Times(num_requests).WillRepeatedly(Return(true));
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(num_requests);
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  std::atomic_int successes(0);
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < num_threads; ++ii)
+  {
+    threads.push_back(std::thread([this, &successes, requests_per_thread] () {
+      for (int jj = 0; jj < requests_per_thread; ++jj)
+      {
+        int status = 0;
+        std::string response;
+        int rc = perform("/BasicHandler", status, response);
+
+        if ((rc == CURLE_OK) && (status == 200) && (response == "OK"))
+        {
+          successes++;
+        }
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  curl_global_cleanup();
+
+  EXPECT_EQ(num_requests, successes.load());
+  EXPECT_EQ(num_requests, _stats_manager._incoming_requests->_count);
+  EXPECT_EQ(num_requests, _stats_manager._latency_us->_count);
+
+  stop_stack();
+}
+
+// A handler that takes a real 1ms to process each request.
+class BusyHandler : public HttpStack::HandlerInterface
+{
+public:
+  void process_request(HttpStack::Request &req, SAS::TrailId trail)
+  {
+    usleep(1000);
+    req.add_content("OK");
+    req.send_reply(200, trail);
+  }
+};
+
+/// Fixture for HttpStack benchmarks. These drive a stack with a real
+/// LoadMonitor, using the real clock, from several clients at once, each of
+/// which sends its requests over a single keep-alive connection.
+class HttpStackBenchmark : public HttpStackTest
+{
+public:
+  /// Starts a stack and measures the rate at which it handles requests.
+  ///
+  /// @param name                    - Name of the benchmark.
+  /// @param num_threads             - Number of threads for the stack.
+  /// @param handler                 - Handler for the requests.
+  /// @param num_connections         - Number of clients, each with its own
+  ///                                  connection.
+  /// @param requests_per_connection - Number of requests each client sends.
+  /// @param unix_socket             - Whether to bind the stack to a unix
+  ///                                  socket rather than a TCP socket.
+  /// @param load_monitor            - Load monitor for the stack. If this is
+  ///                                  NULL, the stack gets a new load monitor
+  ///                                  with a token for every request, and the
+  ///                                  benchmark checks that none are rejected.
+  void run_load(const std::string& name,
+                int num_threads,
+                HttpStack::HandlerInterface* handler,
+                int num_connections,
+                int requests_per_connection,
+                bool unix_socket = false,
+                LoadMonitor* load_monitor = NULL)
+  {
+    int num_requests = num_connections * requests_per_connection;
+    LoadMonitor admit_all_load_monitor(100000, num_requests, num_requests, num_requests, 0);
+    bool allow_rejections = (load_monitor != NULL);
+
+    if (load_monitor == NULL)
+    {
+      load_monitor = &admit_all_load_monitor;
+    }
+
+    delete _stack; _stack = NULL;
+    _stack = new HttpStack(num_threads, NULL, NULL, load_monitor, &_stats_manager);
+
+    if (unix_socket)
+    {
+      start_stack_unix();
+    }
+    else
+    {
+      start_stack();
+    }
+
+    _stack->register_handler("^/Benchmark$", handler);
+
+    // The host in the URL is ignored when talking over a unix socket.
+    std::string url = (unix_socket ? "http://localhost" : _url_prefix) + "/Benchmark";
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    std::vector<CURL*> handles;
+    std::vector<std::string> responses(num_connections);
+
+    for (int ii = 0; ii < num_connections; ++ii)
+    {
+      // Each client reuses its handle for all of its requests, so curl keeps
+      // the connection open between them.
+      CURL* curl = curl_easy_init();
+      proxy_curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &string_store);
+      proxy_curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responses[ii]);
+      proxy_curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+#if LIBCURL_VERSION_NUM >= 0x072800
+      if (unix_socket)
+      {
+        proxy_curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, _socket_path.c_str());
+      }
+#endif
+      handles.push_back(curl);
+    }
+
+    std::atomic_int errors(0);
+    std::atomic_int rejected(0);
+    uint64_t elapsed_ns;
+
+    BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_concurrently(
+      num_connections,
+      requests_per_connection,
+      [&handles, &responses, &errors, &rejected] (int thread, int op) {
+        responses[thread].clear();
+        CURLcode rc = curl_easy_perform(handles[thread]);
+        long status = 0;
+        proxy_curl_easy_getinfo(handles[thread], CURLINFO_RESPONSE_CODE, &status);
+
+        if (rc != CURLE_OK)
+        {
+          errors++;
+        }
+        else if (status == 503)
+        {
+          rejected++;
+        }
+      },
+      elapsed_ns);
+
+    for (CURL* curl : handles)
+    {
+      curl_easy_cleanup(curl);
+    }
+
+    curl_global_cleanup();
+    stop_stack();
+
+    EXPECT_EQ(0, errors.load());
+
+    if (!allow_rejections)
+    {
+      EXPECT_EQ(0, rejected.load());
+    }
+
+    stats.report(name + " (" + std::to_string(num_threads) + " threads, " +
+                   std::to_string(num_connections) + " connections, " +
+                   std::to_string(rejected.load()) + " rejected)",
+                 elapsed_ns);
+  }
+
+  FakeSimpleStatsManager _stats_manager;
+};
+
+TEST_F(HttpStackBenchmark, BasicHandler)
+{
+  BasicHandler handler;
+
+  for (int num_threads : {1, 4})
+  {
+    run_load("HttpStack BasicHandler over TCP",
+             num_threads,
+             &handler,
+             8,
+             100 * BenchmarkUtils::scale());
+  }
+}
+
+TEST_F(HttpStackBenchmark, BusyHandler)
+{
+  BusyHandler handler;
+
+  for (int num_threads : {1, 4, 16})
+  {
+    run_load("HttpStack 1ms handler over TCP",
+             num_threads,
+             &handler,
+             16,
+             10 * BenchmarkUtils::scale());
+  }
+}
+
+// Every request records a penalty, so the load monitor cuts its token rate
+// as the benchmark runs. Once the bucket has run dry, requests are rejected,
+// which this measures the cost of.
+TEST_F(HttpStackBenchmark, PenaltyHandler)
+{
+  PenaltyHandler handler;
+  LoadMonitor load_monitor(100000, 100, 1000, 10, 0);
+
+  run_load("HttpStack penalty handler over TCP",
+           4,
+           &handler,
+           8,
+           100 * BenchmarkUtils::scale(),
+           false,
+           &load_monitor);
+}
+
+// Older versions of curl can't talk to unix domain sockets (see
+// BindUnixSocket).
+#if LIBCURL_VERSION_NUM >= 0x072800
+TEST_F(HttpStackBenchmark, BasicHandlerUnixSocket)
+{
+  BasicHandler handler;
+
+  run_load("HttpStack BasicHandler over unix socket",
+           4,
+           &handler,
+           8,
+           100 * BenchmarkUtils::scale(),
+           true);
+}
+#endif
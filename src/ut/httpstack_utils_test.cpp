@@ -20,6 +20,7 @@
 
 #include "mockhttpstack.hpp"
 #include "mock_sas.h"
+#include "benchmark_utils.hpp"
 
 using ::testing::_;
 
@@ -363,6 +364,71 @@ TEST_F(HandlerUtilsTest, SingleThreadReuse)
 }
 
 
+TEST_F(HandlerUtilsTest, MultipleThreadsReuse)
+{
+  // Check that a pool with several worker threads handles every request when
+  // there are many more requests than workers.
+  TestSemaphoreHandler semaphore_handler;
+  HttpStackUtils::HandlerThreadPool pool(4, NULL);
+  HttpStack::HandlerInterface* handler = pool.wrap(&semaphore_handler);
+
+  const int NUM_REQUESTS = 1000;
+
+  for (int i = 0; i < NUM_REQUESTS; ++i)
+  {
+    MockHttpStack::Request req(_httpstack, "/", "kermit");
+    handler->process_request(req, FAKE_TRAIL_ID);
+  }
+
+  for (int i = 0; i < NUM_REQUESTS; ++i)
+  {
+    bool ok = semaphore_handler.wait_for_request(10 * 1000000); // 10s timeout.
+    ASSERT_TRUE(ok);
+  }
+}
+
+TEST_F(HandlerUtilsTest, QueuedRequestsWaitForBlockedWorker)
+{
+  // Check that requests queued behind a blocked worker are held (not dropped
+  // or rejected) however long the worker is blocked for, and are all handled
+  // once it is free.
+  //
+  // Test this by blocking the only worker thread on a barrier that the testbed
+  // thread doesn't arrive at until the other requests are queued.
+  Barrier barrier(2);
+  TestBarrierHandler barrier_handler(&barrier);
+  TestSemaphoreHandler semaphore_handler;
+
+  HttpStackUtils::HandlerThreadPool pool(1, NULL);
+  HttpStack::HandlerInterface* blocking_handler = pool.wrap(&barrier_handler);
+  HttpStack::HandlerInterface* handler = pool.wrap(&semaphore_handler);
+
+  {
+    MockHttpStack::Request req(_httpstack, "/", "kermit");
+    blocking_handler->process_request(req, FAKE_TRAIL_ID);
+  }
+
+  const int NUM_REQUESTS = 50;
+
+  for (int i = 0; i < NUM_REQUESTS; ++i)
+  {
+    MockHttpStack::Request req(_httpstack, "/", "kermit");
+    handler->process_request(req, FAKE_TRAIL_ID);
+  }
+
+  // None of the queued requests can be handled while the worker is blocked.
+  EXPECT_FALSE(semaphore_handler.wait_for_request(100 * 1000)); // 100ms timeout.
+
+  bool ok = barrier.arrive(10 * 1000000); // 10s timeout.
+  EXPECT_TRUE(ok);
+
+  for (int i = 0; i < NUM_REQUESTS; ++i)
+  {
+    ok = semaphore_handler.wait_for_request(10 * 1000000); // 10s timeout.
+    ASSERT_TRUE(ok);
+  }
+}
+
 TEST_F(HandlerUtilsTest, SasLogLevelPassThrough)
 {
   // Check that the thread pool passes calls to sas_log_level through to the
@@ -437,3 +503,69 @@ TEST_F(HandlerUtilsTest, PingHandler)
   handler.process_request(req, 0);
   EXPECT_EQ("OK", req.content());
 }
+
+
+/// Fixture for HttpStackUtils benchmarks.
+class HandlerUtilsBenchmark : public HandlerUtilsTest
+{
+};
+
+// Measures the rate at which a HandlerThreadPool gets requests from the thread
+// that submits them to its workers and through a trivial handler. The latency
+// reported is the time taken to queue each request.
+TEST_F(HandlerUtilsBenchmark, HandlerThreadPoolThroughput)
+{
+  for (int num_workers : {1, 4, 16})
+  {
+    TestSemaphoreHandler semaphore_handler;
+    HttpStackUtils::HandlerThreadPool pool(num_workers, NULL);
+    HttpStack::HandlerInterface* handler = pool.wrap(&semaphore_handler);
+
+    int num_requests = 10000 * BenchmarkUtils::scale();
+    uint64_t elapsed_ns;
+    uint64_t start_ns = BenchmarkUtils::now_ns();
+
+    BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_sequentially(
+      num_requests,
+      [this, handler] (int op) {
+        MockHttpStack::Request req(_httpstack, "/", "kermit");
+        handler->process_request(req, FAKE_TRAIL_ID);
+      },
+      elapsed_ns);
+
+    for (int i = 0; i < num_requests; ++i)
+    {
+      bool ok = semaphore_handler.wait_for_request(10 * 1000000); // 10s timeout.
+      ASSERT_TRUE(ok);
+    }
+
+    elapsed_ns = BenchmarkUtils::now_ns() - start_ns;
+    stats.report("HandlerThreadPool (" + std::to_string(num_workers) + " workers)",
+                 elapsed_ns);
+  }
+}
+
+// Measures the cost of the per-request allocations on the HTTP hot path: the
+// request object, and the task that the spawning handler creates for it.
+TEST_F(HandlerUtilsBenchmark, SpawningHandlerAllocation)
+{
+  TestCountingTask::Config cfg;
+  HttpStackUtils::SpawningHandler
+    <TestCountingTask, TestCountingTask::Config> handler(&cfg);
+
+  TestCountingTask::reset_counts();
+
+  int num_requests = 100000 * BenchmarkUtils::scale();
+  uint64_t elapsed_ns;
+
+  BenchmarkUtils::LatencyStats stats = BenchmarkUtils::run_sequentially(
+    num_requests,
+    [this, &handler] (int op) {
+      MockHttpStack::Request req(_httpstack, "/", "kermit");
+      handler.process_request(req, FAKE_TRAIL_ID);
+    },
+    elapsed_ns);
+
+  EXPECT_EQ(TestCountingTask::run_count, num_requests);
+  stats.report("SpawningHandler request and task allocation", elapsed_ns);
+}
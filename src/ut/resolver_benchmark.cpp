@@ -0,0 +1,233 @@
+/**
+ * @file resolver_benchmark.cpp Benchmarks for the resolvers, run against a
+ * local fake DNS server.
+ *
+ * Copyright (C) Metaswitch Networks 2019
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "dnscachedresolver.h"
+#include "baseresolver.h"
+#include "httpresolver.h"
+#include "diameterresolver.h"
+#include "benchmark_utils.hpp"
+#include "fakednsserver.hpp"
+
+/// Fixture for the resolver benchmarks. The fake server is scripted with:
+///
+/// -  an A record for a fixed host (used for warm cache lookups)
+/// -  a default A record, so that every distinct name is a cold cache miss
+/// -  NAPTR -> SRV -> A records for a Diameter realm.
+class ResolverBenchmark : public ::testing::Test
+{
+  FakeDnsServer _server;
+  DnsCachedResolver* _dnsresolver;
+  std::atomic_int _next_name;
+
+  ResolverBenchmark() :
+    _dnsresolver(NULL),
+    _next_name(0)
+  {
+    _server.start();
+
+    _server.add_a("warm.bench.cw-ngv.com", 3600, "3.0.0.1");
+    _server.set_default_a(3600, "3.0.0.2");
+
+    _server.add_naptr("bench.cw-ngv.com", 3600, 0, 0, "s", "AAA+D2S", "", "_diameter._sctp.bench.cw-ngv.com");
+    _server.add_srv("_diameter._sctp.bench.cw-ngv.com", 3600, 0, 0, 3868, "hss-1.bench.cw-ngv.com");
+    _server.add_srv("_diameter._sctp.bench.cw-ngv.com", 3600, 0, 0, 3868, "hss-2.bench.cw-ngv.com");
+    _server.add_a("hss-1.bench.cw-ngv.com", 3600, "3.0.1.1");
+    _server.add_a("hss-2.bench.cw-ngv.com", 3600, "3.0.1.2");
+  }
+
+  virtual void SetUp() override
+  {
+    // The server only logs if it fails to bind, so check here rather than
+    // timing resolvers that query port -1.
+    ASSERT_GT(_server.port(), 0);
+    _dnsresolver = create_resolver();
+  }
+
+  virtual ~ResolverBenchmark()
+  {
+    delete _dnsresolver; _dnsresolver = NULL;
+    _server.stop();
+  }
+
+  /// Creates a resolver that queries the fake server.
+  DnsCachedResolver* create_resolver()
+  {
+    std::vector<std::string> servers = {"127.0.0.1"};
+    return new DnsCachedResolver(servers,
+                                 DnsCachedResolver::DEFAULT_TIMEOUT,
+                                 "",
+                                 _server.port());
+  }
+
+  /// Returns a name that no other operation in the test looks up.
+  std::string cold_name()
+  {
+    return "host-" + std::to_string(_next_name++) + ".bench.cw-ngv.com";
+  }
+
+  /// Runs an operation at 1, 8 and 32 threads.
+  void run(const std::string& name, std::function<bool(int, int)> op)
+  {
+    BenchmarkUtils::run_at_concurrencies(name,
+                                         {1, 8, 32},
+                                         32 * BenchmarkUtils::scale(),
+                                         op);
+  }
+};
+
+TEST_F(ResolverBenchmark, DnsCachedResolverWarm)
+{
+  _dnsresolver->dns_query("warm.bench.cw-ngv.com", ns_t_a, 0);
+
+  run("DnsCachedResolver warm cache",
+      [this] (int thread, int op) {
+        return !_dnsresolver->dns_query("warm.bench.cw-ngv.com", ns_t_a, 0).records().empty();
+      });
+}
+
+TEST_F(ResolverBenchmark, DnsCachedResolverCold)
+{
+  run("DnsCachedResolver cold cache",
+      [this] (int thread, int op) {
+        return !_dnsresolver->dns_query(cold_name(), ns_t_a, 0).records().empty();
+      });
+}
+
+TEST_F(ResolverBenchmark, DnsCachedResolverColdDelayed)
+{
+  _server.set_delay_ms(5);
+
+  run("DnsCachedResolver cold cache, 5ms server delay",
+      [this] (int thread, int op) {
+        return !_dnsresolver->dns_query(cold_name(), ns_t_a, 0).records().empty();
+      });
+}
+
+// With lossy responses, the resolver retries until it gets an answer, so the
+// cost of loss shows up in the tail latencies. Lookups that time out on every
+// retry are not counted as failures.
+TEST_F(ResolverBenchmark, DnsCachedResolverColdLossy)
+{
+  _server.set_loss_percent(5);
+
+  run("DnsCachedResolver cold cache, 5% loss",
+      [this] (int thread, int op) {
+        _dnsresolver->dns_query(cold_name(), ns_t_a, 0);
+        return true;
+      });
+}
+
+TEST_F(ResolverBenchmark, BaseResolverA)
+{
+  BaseResolver baseresolver(_dnsresolver);
+  std::map<std::string, int> naptr_services;
+  baseresolver.create_naptr_cache(naptr_services);
+  baseresolver.create_srv_cache();
+  baseresolver.create_blacklist(30, 30);
+
+  run("BaseResolver a_resolve, cold cache",
+      [this, &baseresolver] (int thread, int op) {
+        std::vector<AddrInfo> targets;
+        int ttl;
+        baseresolver.a_resolve(cold_name(), AF_INET, 80, IPPROTO_TCP, 2,
+                               targets, ttl, 1, BaseResolver::ALL_LISTS);
+        return !targets.empty();
+      });
+
+  run("BaseResolver a_resolve, warm cache",
+      [&baseresolver] (int thread, int op) {
+        std::vector<AddrInfo> targets;
+        int ttl;
+        baseresolver.a_resolve("warm.bench.cw-ngv.com", AF_INET, 80, IPPROTO_TCP, 2,
+                               targets, ttl, 1, BaseResolver::ALL_LISTS);
+        return !targets.empty();
+      });
+
+  baseresolver.destroy_blacklist();
+  baseresolver.destroy_srv_cache();
+  baseresolver.destroy_naptr_cache();
+}
+
+TEST_F(ResolverBenchmark, HttpResolver)
+{
+  HttpResolver httpresolver(_dnsresolver, AF_INET, 30, 30);
+
+  run("HttpResolver, cold cache",
+      [this, &httpresolver] (int thread, int op) {
+        std::vector<AddrInfo> targets;
+        httpresolver.resolve(cold_name(), 80, 2, targets, 0, BaseResolver::ALL_LISTS);
+        return !targets.empty();
+      });
+
+  run("HttpResolver, warm cache",
+      [&httpresolver] (int thread, int op) {
+        std::vector<AddrInfo> targets;
+        httpresolver.resolve("warm.bench.cw-ngv.com", 80, 2, targets, 0, BaseResolver::ALL_LISTS);
+        return !targets.empty();
+      });
+}
+
+// Measures the latency seen by many threads that all miss on the same name at
+// once, and how many queries reach the server as a result. Every thread looks
+// up the same sequence of new names, so each name is missed by all of the
+// threads at about the same time.
+TEST_F(ResolverBenchmark, ConcurrentMissesOnSameDomain)
+{
+  _server.set_delay_ms(5);
+  int ops_per_thread = 32 * BenchmarkUtils::scale();
+
+  for (int num_threads : {1, 16, 64})
+  {
+    // Use a new resolver for each run, so that every name starts uncached.
+    DnsCachedResolver* resolver = create_resolver();
+    int queries_before = _server.query_count();
+
+    BenchmarkUtils::run_at_concurrencies(
+      "DnsCachedResolver misses on one domain",
+      {num_threads},
+      ops_per_thread,
+      [resolver] (int thread, int op) {
+        std::string name = "herd-" + std::to_string(op) + ".bench.cw-ngv.com";
+        return !resolver->dns_query(name, ns_t_a, 0).records().empty();
+      });
+
+    std::cout << "[ BENCHMARK] " << num_threads << " threads sent "
+              << (_server.query_count() - queries_before) << " queries for "
+              << ops_per_thread << " names" << std::endl;
+
+    delete resolver; resolver = NULL;
+  }
+}
+
+// The Diameter realm resolves through NAPTR, SRV and A records, so the first
+// resolution makes three round trips to the server and every later one is
+// served from the caches.
+TEST_F(ResolverBenchmark, DiameterResolver)
+{
+  DiameterResolver diameterresolver(_dnsresolver, AF_INET);
+
+  run("DiameterResolver NAPTR/SRV/A",
+      [&diameterresolver] (int thread, int op) {
+        std::vector<AddrInfo> targets;
+        int ttl;
+        diameterresolver.resolve("bench.cw-ngv.com", "", 2, targets, ttl);
+        return !targets.empty();
+      });
+}
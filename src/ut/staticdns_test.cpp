@@ -18,6 +18,7 @@
 #include "gtest/gtest.h"
 #include "test_interposer.hpp"
 #include "test_utils.hpp"
+#include "benchmark_utils.hpp"
 #include "static_dns_cache.h"
 
 using namespace std;
@@ -481,3 +482,116 @@ TEST_F(StaticDnsCacheTest, BadNameJson)
 
   EXPECT_EQ(cache.get_canonical_name("two.redirected.domain"), "two.made.up.domain");
 }
+
+// Each lookup made while the config is being reloaded should see either the
+// old config or the new config in full, never a mixture of the two. The A
+// record and CNAME lookups are separate calls, so a reload can fall between
+// them and this test doesn't check that they see the same config. After each
+// reload, the main thread checks that the cache matches the file it loaded.
+TEST_F(StaticDnsCacheTest, ConfigReloadConcurrentLookups)
+{
+  const int NUM_READERS = 4;
+  const int NUM_RELOADS = 20;
+
+  std::string target_file = DNS_JSON_TMP_DIR + "reload.json";
+  std::string files[] = {DNS_JSON_DIR + "a_records.json",
+                         DNS_JSON_DIR + "a_records2.json"};
+
+  std::string cp_command = "cp " + files[0] + " " + target_file;
+  ASSERT_EQ(0, system(cp_command.c_str()));
+  StaticDnsCache cache(target_file.c_str());
+
+  std::atomic_bool done(false);
+  std::atomic_int mismatches(0);
+  std::vector<std::thread> readers;
+
+  for (int ii = 0; ii < NUM_READERS; ++ii)
+  {
+    readers.push_back(std::thread([&cache, &done, &mismatches] () {
+      while (!done.load())
+      {
+        DnsResult res = cache.get_static_dns_records("a.records.domain", ns_t_a);
+
+        // The first file has two records starting 10.0.0.1, and the second
+        // has three starting 10.16.16.16.
+        char addr[INET_ADDRSTRLEN] = "";
+        if (!res.records().empty())
+        {
+          DnsARecord* first = dynamic_cast<DnsARecord*>(res.records()[0]);
+          struct in_addr first_addr = first->address();
+          inet_ntop(AF_INET, &first_addr, addr, sizeof(addr));
+        }
+
+        if (!(((res.records().size() == 2) && (std::string(addr) == "10.0.0.1")) ||
+              ((res.records().size() == 3) && (std::string(addr) == "10.16.16.16"))))
+        {
+          mismatches++;
+        }
+
+        // Only the first file has a CNAME for this name.
+        std::string translated = cache.get_canonical_name("one.extra.domain");
+        if ((translated != "one.made.up.domain") &&
+            (translated != "one.extra.domain"))
+        {
+          mismatches++;
+        }
+      }
+    }));
+  }
+
+  for (int ii = 0; ii < NUM_RELOADS; ++ii)
+  {
+    bool first_file = ((ii + 1) % 2 == 0);
+    cp_command = "cp " + files[(ii + 1) % 2] + " " + target_file;
+
+    // Don't ASSERT here: returning with the readers still running would kill
+    // the whole UT binary rather than just failing this test.
+    int rc = system(cp_command.c_str());
+    EXPECT_EQ(0, rc);
+    if (rc != 0)
+    {
+      break;
+    }
+
+    cache.reload_static_records();
+
+    DnsResult res = cache.get_static_dns_records("a.records.domain", ns_t_a);
+    EXPECT_EQ(first_file ? 2u : 3u, res.records().size());
+    EXPECT_EQ(first_file ? "one.made.up.domain" : "one.extra.domain",
+              cache.get_canonical_name("one.extra.domain"));
+  }
+
+  done.store(true);
+  for (std::thread& reader : readers)
+  {
+    reader.join();
+  }
+
+  EXPECT_EQ(0, mismatches.load());
+}
+
+// Measures the rate at which threads can look up static records and CNAMEs,
+// which happens on every DNS query.
+TEST(StaticDnsCacheBenchmark, Lookups)
+{
+  StaticDnsCache cache(DNS_JSON_DIR + "a_records.json");
+
+  BenchmarkUtils::run_at_concurrencies(
+    "StaticDnsCache lookups",
+    {1, 4, 16},
+    10000 * BenchmarkUtils::scale(),
+    [&cache] (int thread, int op) {
+      // Alternate between names that are and aren't in the file, as most
+      // queries are for names that aren't.
+      if (op % 2 == 0)
+      {
+        return ((cache.get_canonical_name("one.extra.domain") == "one.made.up.domain") &&
+                (!cache.get_static_dns_records("a.records.domain", ns_t_a).records().empty()));
+      }
+      else
+      {
+        return ((cache.get_canonical_name("not.in.the.file") == "not.in.the.file") &&
+                (cache.get_static_dns_records("not.in.the.file", ns_t_a).records().empty()));
+      }
+    });
+}
@@ -81,6 +81,16 @@ int main(int argc, char** argv)
   // no need for calling testing::InitGoogleTest() separately.
   testing::InitGoogleMock(&argc, argv);
 
+  // Benchmarks are slow under valgrind and their results depend on timing, so
+  // they only run when BENCHMARK_SCALE is set (see benchmark_utils.hpp).
+  if (getenv("BENCHMARK_SCALE") == NULL)
+  {
+    std::string filter = testing::GTEST_FLAG(filter);
+    filter += (filter.find('-') == std::string::npos) ? "-" : ":";
+    filter += "*Benchmark.*";
+    testing::GTEST_FLAG(filter) = filter;
+  }
+
   // Set up a signal handler to catch SIGSEGV.
   struct sigaction lsigaction;
   memset(&lsigaction, 0, sizeof(lsigaction));